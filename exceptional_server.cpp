@@ -1,49 +1,301 @@
+#include "exceptional_server.h"
 #include <iostream>
-#include <exception>
 #include <string>
-#include <stdexcept>
 #include <vector>
-#include <cmath>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <cstdlib>
+#include <cctype>
+#include <limits>
+#include <algorithm>
+#include <cstdio>
+#include <charconv>
+#include <unistd.h>
 using namespace std;
 
-class Server {
-private:
-	static int load;
+/***
+ * Per thread server_stats, with an optional snapshot every so many requests
+ * Reports go to stderr so stdout is unchanged
+ */
+class stats_reporter {
 public:
-	static int compute(long long A, long long B) {
-		load += 1;
-		if(A < 0) {
-			throw std::invalid_argument("A is negative");
-		}
-		vector<int> v(A, 0);
-		int real = -1, cmplx = sqrt(-1);
-		if(B == 0) throw 0;
-		real = (A/B)*real;
-		int ans = v.at(B);
-		return real + A - B*ans;
+	stats_reporter(unsigned num_threads, uint64_t every)
+			: per_thread(new server_stats[num_threads]), num_threads(num_threads), every(every) {}
+	server_stats* thread_stats(unsigned thread) { return &per_thread[thread]; }
+	/***
+	 * Call after each request, prints a snapshot when one is due
+	 */
+	void completed() {
+		if(every == 0)
+			return;
+		uint64_t n = done.fetch_add(1, std::memory_order_relaxed) + 1;
+		if(n % every == 0)
+			print("snapshot after", true);
 	}
-	static int getLoad() {
-		return load;
+	/***
+	 * Sum the threads and write a report, labelled with the requests it covers
+	 * @param label what to print before the count
+	 * @param show_count true to print the number of requests after the label
+	 */
+	void print(const string& label, bool show_count = false) {
+		// summed under the lock so snapshots come out in order
+		std::lock_guard<std::mutex> lock(print_mutex);
+		server_stats_snapshot snapshot;
+		for(unsigned t = 0; t < num_threads; ++t)
+			snapshot.add(per_thread[t]);
+		clog << label;
+		if(show_count)
+			clog << " " << snapshot.total() << " requests";
+		clog << "\n";
+		snapshot.print(clog);
 	}
+private:
+	std::unique_ptr<server_stats[]> per_thread;
+	unsigned num_threads;
+	uint64_t every;
+	std::atomic<uint64_t> done{0};
+	std::mutex print_mutex;
 };
-int Server::load = 0;
 
-int main() {
+/***
+ * Run one request, writing the result or error to out
+ * @param out where to write
+ * @param A first argument
+ * @param B second argument
+ * @param stats where to record the outcome and latency, or nullptr
+ */
+void handle(std::ostream& out, long long A, long long B, server_stats* stats) {
+	compute_result res;
+	if(stats != nullptr) {
+		auto start = std::chrono::steady_clock::now();
+		res = Server::try_compute(A, B);
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		stats->record(res.error, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	} else {
+		res = Server::try_compute(A, B);
+	}
+	switch(res.error) {
+		case compute_error::none:
+			out << res.value;
+			break;
+		case compute_error::bad_alloc:
+			out << "Not enough memory\n";
+			break;
+		case compute_error::other:
+			out << "Other Exception\n";
+			break;
+		default:
+			out << "Exception: " << res.message() << "\n";
+	}
+}
+
+/***
+ * Run all requests on a pool of worker threads
+ * Each result is buffered and printed in input order once all workers finish
+ * @param out where to write the results
+ * @param requests the (A, B) pairs
+ * @param num_threads the number of workers
+ * @param reporter where to record stats, or nullptr
+ */
+void run_pool(std::ostream& out, const vector<pair<long long, long long>>& requests,
+		unsigned num_threads, stats_reporter* reporter) {
+	vector<string> results(requests.size());
+	std::atomic<size_t> next(0);
+	vector<std::thread> workers;
+	for(unsigned t = 0; t < num_threads; ++t) {
+		workers.emplace_back([&, t]() {
+			server_stats* stats = reporter != nullptr ? reporter->thread_stats(t) : nullptr;
+			std::ostringstream buf;
+			size_t i;
+			while((i = next.fetch_add(1)) < requests.size()) {
+				buf.str("");
+				handle(buf, requests[i].first, requests[i].second, stats);
+				results[i] = buf.str();
+				if(reporter != nullptr)
+					reporter->completed();
+			}
+		});
+	}
+	for(auto& w : workers)
+		w.join();
+	for(const auto& r : results)
+		out << r;
+}
+
+/***
+ * @returns the number of ints that fit in physical memory
+ */
+long long default_alloc_limit() {
+	long long pages = sysconf(_SC_PHYS_PAGES);
+	long long page_size = sysconf(_SC_PAGE_SIZE);
+	if(pages <= 0 || page_size <= 0)
+		return std::numeric_limits<long long>::max();
+	return pages / sizeof(int) * page_size;
+}
+
+/***
+ * Parse the request count and the (A, B) pairs from a buffer, the way
+ * istream >> would: leading whitespace and an optional + are skipped
+ * Parsing stops at the first pair that is missing or not a number
+ * @param in the whole input
+ * @param A receives the first arguments
+ * @param B receives the second arguments
+ */
+void parse_batch(const string& in, vector<long long>& A, vector<long long>& B) {
+	const char* pos = in.data();
+	const char* end = in.data() + in.size();
+	auto next_number = [&](long long& val) {
+		while(pos < end && isspace((unsigned char)*pos))
+			++pos;
+		if(pos + 1 < end && *pos == '+' && *(pos + 1) != '-')
+			++pos;
+		auto res = std::from_chars(pos, end, val);
+		pos = res.ptr;
+		return res.ec == std::errc();
+	};
+	long long T = 0;
+	if(!next_number(T) || T < 0)
+		T = 0;
+	// every pair takes at least 4 characters, so a bad count can not size the arrays
+	T = std::min<long long>(T, in.size() / 4);
+	A.resize(T);
+	B.resize(T);
+	for(long long i = 0; i < T; ++i) {
+		if(!next_number(A[i]) || !next_number(B[i])) {
+			A.resize(i);
+			B.resize(i);
+			break;
+		}
+	}
+}
+
+/***
+ * Read all of stdin, run it through Server::compute_batch and write
+ * the output with one call
+ * @param reporter where to record outcomes, or nullptr. The kernel does not time
+ * single requests, so only counts and the time for the whole batch are kept
+ */
+void run_batch(stats_reporter* reporter) {
+	string in;
+	char chunk[1 << 16];
+	size_t n;
+	while((n = fread(chunk, 1, sizeof(chunk), stdin)) > 0)
+		in.append(chunk, n);
+
+	vector<long long> A, B;
+	parse_batch(in, A, B);
+	long long T = A.size();
+
+	vector<int> value(T);
+	vector<compute_error> error(T);
+	auto start = std::chrono::steady_clock::now();
+	Server::compute_batch(A.data(), B.data(), value.data(), error.data(), T, default_alloc_limit());
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	if(reporter != nullptr) {
+		server_stats* stats = reporter->thread_stats(0);
+		for(long long i = 0; i < T; ++i)
+			stats->record(error[i]);
+		clog << "batch of " << T << " took "
+				<< std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() << "ns\n";
+	}
+
+	string out;
+	out.reserve(T * 16);
+	char num[16];
+	for(long long i = 0; i < T; ++i) {
+		switch(error[i]) {
+			case compute_error::none:
+				out.append(num, std::to_chars(num, num + sizeof(num), value[i]).ptr);
+				break;
+			case compute_error::bad_alloc:
+				out += "Not enough memory\n";
+				break;
+			case compute_error::other:
+				out += "Other Exception\n";
+				break;
+			default:
+				out += "Exception: ";
+				out += compute_result{0, error[i], A[i], B[i]}.message();
+				out += "\n";
+		}
+	}
+	out.append(num, std::to_chars(num, num + sizeof(num), Server::getLoad()).ptr);
+	out += "\n";
+	fwrite(out.data(), 1, out.size(), stdout);
+}
+
+#ifndef __JMJ_TESTING__
+
+/***
+ * Usage: exceptional_server [-j threads] [--batch] [--stats] [--stats-every n]
+ * Without -j requests are handled one at a time on the main thread.
+ * -j 0 uses one worker per core.
+ * --batch reads all requests at once and runs them through Server::compute_batch.
+ * Allocations bigger than physical memory are reported as not enough memory
+ * without being tried.
+ * --stats writes outcome counts and latency histograms to stderr at the end.
+ * --stats-every n also writes a snapshot every n requests.
+ */
+int main(int argc, char** argv) {
+	unsigned num_threads = 1;
+	bool batch = false;
+	bool stats = false;
+	uint64_t stats_every = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(string(argv[i]) == "-j" && i + 1 < argc) {
+			num_threads = std::strtoul(argv[++i], nullptr, 10);
+			if(num_threads == 0)
+				num_threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		if(string(argv[i]) == "--batch")
+			batch = true;
+		if(string(argv[i]) == "--stats")
+			stats = true;
+		if(string(argv[i]) == "--stats-every" && i + 1 < argc) {
+			stats = true;
+			stats_every = std::strtoull(argv[++i], nullptr, 10);
+		}
+	}
+	std::unique_ptr<stats_reporter> reporter;
+	if(stats)
+		reporter.reset(new stats_reporter(num_threads, stats_every));
+	if(batch) {
+		run_batch(reporter.get());
+		if(reporter)
+			reporter->print("final");
+		return 0;
+	}
 	int T; cin >> T;
+	if(T < 0)
+		T = 0;
+	// past the end of the input a failed read leaves the last pair in place
+	long long A = 0, B = 0;
+	if(num_threads > 1 && T > 0) {
+		// the count is not trusted, requests only grows with what is actually read
+		vector<pair<long long, long long>> requests;
+		requests.reserve(std::min(T, 1 << 16));
+		while(T > 0 && cin >> A >> B) {
+			requests.emplace_back(A, B);
+			--T;
+		}
+		run_pool(cout, requests, num_threads, reporter.get());
+	}
+	// anything the pool did not read runs here, the same as without -j
+	server_stats* thread_stats = reporter ? reporter->thread_stats(0) : nullptr;
 	while(T--) {
-		long long A, B;
 		cin >> A >> B;
-        try {
-            std::cout << Server::compute(A, B);
-        } catch(const std::bad_alloc& ba) {
-            std::cout << "Not enough memory\n";
-        } catch(const std::exception& se) {
-            std::cout << "Exception: " << se.what() << std::endl;
-        } catch(...) {
-            std::cout << "Other Exception\n";
-        }
-
+		handle(cout, A, B, thread_stats);
+		if(reporter)
+			reporter->completed();
 	}
 	cout << Server::getLoad() << endl;
+	if(reporter)
+		reporter->print("final");
 	return 0;
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,388 @@
+#include <exception>
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <memory>
+#include <new>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <ostream>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define EXCEPTIONAL_SERVER_AVX2
+#endif
+
+/***
+ * What went wrong in a call to Server::try_compute
+ * Each value matches an exception Server::compute would throw
+ */
+enum class compute_error : int32_t {
+	none,             // no error
+	invalid_argument, // std::invalid_argument, A is negative
+	length_error,     // std::length_error, A is more than a vector can hold
+	bad_alloc,        // std::bad_alloc, not enough memory for A ints
+	other,            // throw 0, B is zero
+	out_of_range      // std::out_of_range, B is not an index into A ints
+};
+
+/***
+ * The result of Server::try_compute, either a value or an error
+ * The error message is only built when asked for
+ */
+struct compute_result {
+	int value = 0;
+	compute_error error = compute_error::none;
+	long long A = 0;
+	long long B = 0;
+
+	bool ok() const { return error == compute_error::none; }
+	/***
+	 * @returns the text what() would return for the matching exception
+	 */
+	std::string message() const {
+		switch(error) {
+			case compute_error::invalid_argument:
+				return "A is negative";
+			case compute_error::length_error:
+				return length_error_message();
+			case compute_error::bad_alloc:
+				return std::bad_alloc().what();
+			case compute_error::out_of_range:
+				return out_of_range_message(A, B);
+			default:
+				return "";
+		}
+	}
+private:
+#if defined(__GLIBCXX__)
+	// the text libstdc++ puts in the exceptions std::vector throws
+	static std::string length_error_message() {
+		return "cannot create std::vector larger than max_size()";
+	}
+	static std::string out_of_range_message(long long A, long long B) {
+		return "vector::_M_range_check: __n (which is " + std::to_string((size_t)B)
+				+ ") >= this->size() (which is " + std::to_string((size_t)A) + ")";
+	}
+#else
+	// other libraries do not put the sizes in the text, so ask std::vector once
+	static std::string length_error_message() {
+		static const std::string msg = []() -> std::string {
+			try {
+				std::vector<int> v(std::vector<int>().max_size() + 1);
+			} catch(const std::length_error& le) {
+				return le.what();
+			}
+			return "";
+		}();
+		return msg;
+	}
+	static std::string out_of_range_message(long long, long long) {
+		static const std::string msg = []() -> std::string {
+			try {
+				std::vector<int>().at(0);
+			} catch(const std::out_of_range& oor) {
+				return oor.what();
+			}
+			return "";
+		}();
+		return msg;
+	}
+#endif
+};
+
+class Server {
+private:
+	inline static int load = 0;
+	inline static std::mutex load_mutex;
+	/***
+	 * One thread's count of calls, added to load when the thread exits
+	 */
+	struct load_counter {
+		int count;
+		load_counter() : count(0) {}
+		void merge() {
+			std::lock_guard<std::mutex> lock(load_mutex);
+			load += count;
+			count = 0;
+		}
+		~load_counter() { merge(); }
+	};
+	inline static thread_local load_counter local_load;
+public:
+	/***
+	 * Same as compute(), but errors are returned instead of thrown
+	 * @param A first argument
+	 * @param B second argument
+	 * @returns the value, or the error compute() would have thrown
+	 */
+	static compute_result try_compute(long long A, long long B) noexcept {
+		compute_result res;
+		res.A = A;
+		res.B = B;
+		local_load.count += 1;
+		if(A < 0) {
+			res.error = compute_error::invalid_argument;
+			return res;
+		}
+		if((unsigned long long)A > std::vector<int>().max_size()) {
+			res.error = compute_error::length_error;
+			return res;
+		}
+		std::unique_ptr<int[]> v(new (std::nothrow) int[A]());
+		if(v == nullptr) {
+			res.error = compute_error::bad_alloc;
+			return res;
+		}
+		int real = -1;
+		if(B == 0) {
+			res.error = compute_error::other;
+			return res;
+		}
+		real = (A/B)*real;
+		if((size_t)B >= (size_t)A) {
+			res.error = compute_error::out_of_range;
+			return res;
+		}
+		int ans = v[B];
+		res.value = real + A - B*ans;
+		return res;
+	}
+	/***
+	 * Classify and compute a batch of requests without allocating
+	 * Lanes are classified the same way try_compute would, except that an
+	 * allocation of more than alloc_limit ints is reported as bad_alloc
+	 * instead of being attempted. Uses AVX2 when the cpu has it.
+	 * @param A first arguments
+	 * @param B second arguments
+	 * @param value receives the result of each valid lane, 0 otherwise
+	 * @param error receives the error of each lane
+	 * @param count the number of lanes
+	 * @param alloc_limit the most ints a lane may ask for
+	 */
+	static void compute_batch(const long long* A, const long long* B, int* value,
+			compute_error* error, size_t count, long long alloc_limit) {
+		local_load.count += count;
+		// the vector is all zeros, so B*ans drops out. Quotients are done
+		// in doubles, which are exact below 2^52
+		if(alloc_limit > max_batch_alloc)
+			alloc_limit = max_batch_alloc;
+		size_t i = 0;
+#ifdef EXCEPTIONAL_SERVER_AVX2
+		if(__builtin_cpu_supports("avx2"))
+			i = compute_batch_avx2(A, B, value, error, count, alloc_limit);
+#endif
+		for(; i < count; ++i) {
+			error[i] = classify(A[i], B[i], alloc_limit);
+			value[i] = error[i] == compute_error::none ? (int)(A[i] - A[i]/B[i]) : 0;
+		}
+	}
+	static int compute(long long A, long long B) {
+		compute_result res = try_compute(A, B);
+		switch(res.error) {
+			case compute_error::none:
+				return res.value;
+			case compute_error::invalid_argument:
+				throw std::invalid_argument(res.message());
+			case compute_error::length_error:
+				throw std::length_error(res.message());
+			case compute_error::bad_alloc:
+				throw std::bad_alloc();
+			case compute_error::out_of_range:
+				throw std::out_of_range(res.message());
+			default:
+				throw 0;
+		}
+	}
+	/***
+	 * @returns the calls made by threads that have exited, plus the calling thread
+	 */
+	static int getLoad() {
+		local_load.merge();
+		std::lock_guard<std::mutex> lock(load_mutex);
+		return load;
+	}
+private:
+	static constexpr long long max_batch_alloc = (1LL << 52) - 1;
+
+	static compute_error classify(long long A, long long B, long long alloc_limit) {
+		if(A < 0)
+			return compute_error::invalid_argument;
+		if((unsigned long long)A > std::vector<int>().max_size())
+			return compute_error::length_error;
+		if(A > alloc_limit)
+			return compute_error::bad_alloc;
+		if(B == 0)
+			return compute_error::other;
+		if((unsigned long long)B >= (unsigned long long)A)
+			return compute_error::out_of_range;
+		return compute_error::none;
+	}
+#ifdef EXCEPTIONAL_SERVER_AVX2
+	/***
+	 * Four lanes at a time, each lane picks its error with masks rather than branches
+	 * @returns the number of lanes done, the caller does the rest
+	 */
+	__attribute__((target("avx2")))
+	static size_t compute_batch_avx2(const long long* A, const long long* B, int* value,
+			compute_error* error, size_t count, long long alloc_limit) {
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i one = _mm256_set1_epi64x(1);
+		const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+		const __m256i max_size = _mm256_set1_epi64x((long long)std::vector<int>().max_size());
+		const __m256i limit = _mm256_set1_epi64x(alloc_limit);
+		const __m256i two52_bits = _mm256_set1_epi64x(0x4330000000000000LL);
+		const __m256d two52 = _mm256_set1_pd(4503599627370496.0);
+		// the low half of each 64 bit lane, packed into the low 128 bits
+		const __m256i pack = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+		const __m256i invalid_argument = _mm256_set1_epi64x((long long)compute_error::invalid_argument);
+		const __m256i length_error = _mm256_set1_epi64x((long long)compute_error::length_error);
+		const __m256i bad_alloc = _mm256_set1_epi64x((long long)compute_error::bad_alloc);
+		const __m256i other = _mm256_set1_epi64x((long long)compute_error::other);
+		const __m256i out_of_range = _mm256_set1_epi64x((long long)compute_error::out_of_range);
+
+		size_t i = 0;
+		for(; i + 4 <= count; i += 4) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(A + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(B + i));
+
+			__m256i negative = _mm256_cmpgt_epi64(zero, a);
+			__m256i too_long = _mm256_cmpgt_epi64(a, max_size);
+			__m256i too_big = _mm256_cmpgt_epi64(a, limit);
+			__m256i b_zero = _mm256_cmpeq_epi64(b, zero);
+			// unsigned b >= a is !(a > b) once both are shifted into signed range
+			__m256i range = _mm256_xor_si256(_mm256_cmpgt_epi64(
+					_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign)), _mm256_set1_epi64x(-1));
+
+			// lowest priority first, so earlier checks in try_compute win
+			__m256i err = _mm256_and_si256(range, out_of_range);
+			err = _mm256_blendv_epi8(err, other, b_zero);
+			err = _mm256_blendv_epi8(err, bad_alloc, too_big);
+			err = _mm256_blendv_epi8(err, length_error, too_long);
+			err = _mm256_blendv_epi8(err, invalid_argument, negative);
+			__m256i valid = _mm256_cmpeq_epi64(err, zero);
+
+			// keep the division safe on lanes that are thrown away
+			__m256i sa = _mm256_blendv_epi8(one, a, valid);
+			__m256i sb = _mm256_blendv_epi8(one, b, valid);
+			__m256d da = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(sa, two52_bits)), two52);
+			__m256d db = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(sb, two52_bits)), two52);
+			__m256d dq = _mm256_round_pd(_mm256_div_pd(da, db), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+			__m256i q = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(dq, two52)), two52_bits);
+			// (int)(real + A) keeps only the low 32 bits, so real needs no sign extension
+			__m256i res = _mm256_and_si256(_mm256_sub_epi64(sa, q), valid);
+
+			_mm_storeu_si128((__m128i*)(value + i),
+					_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(res, pack)));
+			_mm_storeu_si128((__m128i*)(error + i),
+					_mm256_castsi256_si128(_mm256_permutevar8x32_epi32(err, pack)));
+		}
+		return i;
+	}
+#endif
+};
+
+/***
+ * Outcome counts and latency histograms for one thread of the driver
+ * Only the owning thread writes, so updates are plain relaxed stores and
+ * other threads may read a snapshot at any time.
+ */
+struct alignas(64) server_stats {
+	static constexpr int outcome_count = (int)compute_error::out_of_range + 1;
+	// bucket b holds latencies of [2^b, 2^(b+1)) ns
+	static constexpr int bucket_count = 40;
+
+	std::atomic<uint64_t> count[outcome_count] = {};
+	std::atomic<uint64_t> latency_ns[outcome_count] = {};
+	std::atomic<uint64_t> histogram[outcome_count][bucket_count] = {};
+
+	static int bucket(uint64_t ns) {
+		int b = 63 - __builtin_clzll(ns | 1);
+		return b < bucket_count ? b : bucket_count - 1;
+	}
+	/***
+	 * Count a request without timing it
+	 */
+	void record(compute_error e) {
+		bump(count[(int)e], 1);
+	}
+	/***
+	 * Count a request and add its latency to the histogram
+	 */
+	void record(compute_error e, uint64_t ns) {
+		bump(count[(int)e], 1);
+		bump(latency_ns[(int)e], ns);
+		bump(histogram[(int)e][bucket(ns)], 1);
+	}
+private:
+	static void bump(std::atomic<uint64_t>& val, uint64_t by) {
+		val.store(val.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+	}
+};
+
+/***
+ * The sum of one or more server_stats at a point in time
+ */
+struct server_stats_snapshot {
+	uint64_t count[server_stats::outcome_count] = {};
+	uint64_t latency_ns[server_stats::outcome_count] = {};
+	uint64_t histogram[server_stats::outcome_count][server_stats::bucket_count] = {};
+
+	void add(const server_stats& stats) {
+		for(int i = 0; i < server_stats::outcome_count; ++i) {
+			count[i] += stats.count[i].load(std::memory_order_relaxed);
+			latency_ns[i] += stats.latency_ns[i].load(std::memory_order_relaxed);
+			for(int b = 0; b < server_stats::bucket_count; ++b)
+				histogram[i][b] += stats.histogram[i][b].load(std::memory_order_relaxed);
+		}
+	}
+	uint64_t total() const {
+		uint64_t sum = 0;
+		for(int i = 0; i < server_stats::outcome_count; ++i)
+			sum += count[i];
+		return sum;
+	}
+	/***
+	 * @param outcome the outcome to look at
+	 * @param fraction e.g. 0.99 for p99
+	 * @returns the upper bound of the bucket holding that percentile, 0 if nothing was timed
+	 */
+	uint64_t percentile_ns(compute_error outcome, double fraction) const {
+		const uint64_t* h = histogram[(int)outcome];
+		uint64_t samples = 0;
+		for(int b = 0; b < server_stats::bucket_count; ++b)
+			samples += h[b];
+		if(samples == 0)
+			return 0;
+		uint64_t seen = 0;
+		for(int b = 0; b < server_stats::bucket_count; ++b) {
+			seen += h[b];
+			if(seen >= fraction * samples)
+				return 2ULL << b;
+		}
+		return 2ULL << (server_stats::bucket_count - 1);
+	}
+	/***
+	 * Write one line per outcome: count, mean, p50, p99 and max latency
+	 */
+	void print(std::ostream& out) const {
+		static const char* names[server_stats::outcome_count] = {
+			"ok", "invalid_argument", "length_error", "bad_alloc", "other", "out_of_range" };
+		out << "requests: " << total() << "\n";
+		for(int i = 0; i < server_stats::outcome_count; ++i) {
+			out << "  " << names[i] << ": " << count[i];
+			uint64_t samples = 0;
+			for(int b = 0; b < server_stats::bucket_count; ++b)
+				samples += histogram[i][b];
+			if(samples > 0) {
+				compute_error e = (compute_error)i;
+				out << " mean " << latency_ns[i] / samples << "ns"
+						<< " p50 <" << percentile_ns(e, 0.5) << "ns"
+						<< " p99 <" << percentile_ns(e, 0.99) << "ns"
+						<< " max <" << percentile_ns(e, 1.0) << "ns";
+			}
+			out << "\n";
+		}
+	}
+};
@@ -0,0 +1,113 @@
+#include "exceptional_server.h"
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+using namespace std;
+
+/***
+ * Compare the throwing Server::compute with Server::try_compute
+ * at different error rates. Errors are spread evenly over negative A,
+ * zero B, out of range B and A too big to allocate.
+ * Each rate runs twice: once with A of 1000-9999, where zero filling the
+ * vector costs about as much as the exception, and once with A of 2-16,
+ * where the exception cost stands out.
+ */
+
+/***
+ * Build a set of requests
+ * @param count how many
+ * @param error_rate fraction of requests that fail
+ * @param min_a smallest A
+ * @param max_a largest A
+ * @returns the (A, B) pairs
+ */
+vector<pair<long long, long long>> make_requests(size_t count, double error_rate,
+		long long min_a, long long max_a) {
+	mt19937_64 gen(42);
+	uniform_real_distribution<double> pick(0.0, 1.0);
+	uniform_int_distribution<long long> small(min_a, max_a);
+	vector<pair<long long, long long>> requests;
+	requests.reserve(count);
+	for(size_t i = 0; i < count; ++i) {
+		long long A = small(gen);
+		long long B = small(gen) % (A - 1) + 1;
+		if(pick(gen) < error_rate) {
+			switch(i % 4) {
+				case 0: A = -A; break;
+				case 1: B = 0; break;
+				case 2: B = A + B; break;
+				case 3: A = 51975592548100; break;
+			}
+		}
+		requests.emplace_back(A, B);
+	}
+	return requests;
+}
+
+long long time_throw(const vector<pair<long long, long long>>& requests, long long& sink) {
+	auto start = chrono::steady_clock::now();
+	for(const auto& r : requests) {
+		try {
+			sink += Server::compute(r.first, r.second);
+		} catch(const std::bad_alloc& ba) {
+			sink += 1;
+		} catch(const std::exception& se) {
+			sink += 2;
+		} catch(...) {
+			sink += 3;
+		}
+	}
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+long long time_expected(const vector<pair<long long, long long>>& requests, long long& sink) {
+	auto start = chrono::steady_clock::now();
+	for(const auto& r : requests) {
+		compute_result res = Server::try_compute(r.first, r.second);
+		switch(res.error) {
+			case compute_error::none: sink += res.value; break;
+			case compute_error::bad_alloc: sink += 1; break;
+			case compute_error::other: sink += 3; break;
+			default: sink += 2;
+		}
+	}
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+	const size_t count = argc > 1 ? stoul(argv[1]) : 100000;
+	long long sink = 0;
+	cout << setw(10) << "A" << setw(10) << "error %" << setw(16) << "throw ns/req"
+			<< setw(16) << "expected ns/req" << endl;
+	int run = 0;
+	for(auto a_range : { make_pair(1000LL, 9999LL), make_pair(2LL, 16LL) }) {
+		for(double error_rate : { 0.0, 0.1, 0.25, 0.5, 0.9, 1.0 }) {
+			auto requests = make_requests(count, error_rate, a_range.first, a_range.second);
+
+			// each path gets an untimed warm up pass, and the order alternates
+			// so neither one always runs on an allocator the other warmed
+			long long throw_ns, expected_ns;
+			if(run++ % 2 == 0) {
+				time_throw(requests, sink);
+				throw_ns = time_throw(requests, sink);
+				time_expected(requests, sink);
+				expected_ns = time_expected(requests, sink);
+			} else {
+				time_expected(requests, sink);
+				expected_ns = time_expected(requests, sink);
+				time_throw(requests, sink);
+				throw_ns = time_throw(requests, sink);
+			}
+
+			cout << setw(10) << (to_string(a_range.first) + "-" + to_string(a_range.second))
+					<< setw(10) << (int)(error_rate * 100)
+					<< setw(16) << fixed << setprecision(1) << (double)throw_ns / count
+					<< setw(16) << (double)expected_ns / count << endl;
+		}
+	}
+	// keep the results alive so the loops are not optimized away
+	clog << "checksum " << sink << endl;
+	return 0;
+}
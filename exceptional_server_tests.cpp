@@ -0,0 +1,218 @@
+#define __JMJ_TESTING__
+#include "exceptional_server.cpp"
+#include <gtest/gtest.h>
+#include <fstream>
+
+/***
+ * @returns the (A, B) pairs in exceptional_server1.txt
+ */
+std::vector<std::pair<long long, long long>> load_requests()
+{
+    std::vector<std::pair<long long, long long>> requests;
+    std::ifstream in("exceptional_server1.txt");
+    if (!in.good())
+    {
+        ADD_FAILURE() << "unable to open exceptional_server1.txt";
+        return requests;
+    }
+    int T;
+    in >> T;
+    while(T--)
+    {
+        long long A, B;
+        in >> A >> B;
+        requests.emplace_back(A, B);
+    }
+    return requests;
+}
+
+/***
+ * Server::compute as it was, before try_compute
+ */
+int original(long long A, long long B)
+{
+    std::vector<int> v(A, 0);
+    int real = -1;
+    if (B == 0) throw 0;
+    real = (A/B)*real;
+    int ans = v.at(B);
+    return real + A - B*ans;
+}
+
+/***
+ * @returns what the driver would print for func(A, B), without the newline
+ */
+template<class F>
+std::string run(F func, long long A, long long B)
+{
+    try {
+        return std::to_string(func(A, B));
+    } catch(const std::bad_alloc& ba) {
+        return "Not enough memory";
+    } catch(const std::exception& se) {
+        return std::string("Exception: ") + se.what();
+    } catch(...) {
+        return "Other Exception";
+    }
+}
+
+TEST(exceptional_server_tests, try_compute)
+{
+    compute_result res = Server::try_compute(25581, 3661);
+    EXPECT_TRUE(res.ok());
+    EXPECT_EQ(res.value, 25575);
+
+    res = Server::try_compute(-9252, 888);
+    EXPECT_EQ(res.error, compute_error::invalid_argument);
+    EXPECT_EQ(res.message(), "A is negative");
+
+    res = Server::try_compute(6003, 0);
+    EXPECT_EQ(res.error, compute_error::other);
+
+    res = Server::try_compute(3850, 921492);
+    EXPECT_EQ(res.error, compute_error::out_of_range);
+    EXPECT_EQ("Exception: " + res.message(), run(original, 3850, 921492));
+
+    res = Server::try_compute(51975592548100, 2718);
+    EXPECT_EQ(res.error, compute_error::bad_alloc);
+
+    res = Server::try_compute(std::numeric_limits<long long>::max(), 2718);
+    EXPECT_EQ(res.error, compute_error::length_error);
+    EXPECT_EQ("Exception: " + res.message(), run(original, std::numeric_limits<long long>::max(), 2718));
+}
+
+/***
+ * The throwing API should throw what the original vector based version threw
+ */
+TEST(exceptional_server_tests, compute_matches_vector)
+{
+    auto requests = load_requests();
+    ASSERT_FALSE(requests.empty());
+    for(const auto& [A, B] : requests)
+    {
+        if (A < 0)
+            continue;
+        EXPECT_EQ(run(Server::compute, A, B), run(original, A, B)) << "A=" << A << " B=" << B;
+    }
+    EXPECT_EQ(run(Server::compute, 10, -1), run(original, 10, -1));
+    EXPECT_EQ(run(Server::compute, 0, 0), run(original, 0, 0));
+}
+
+/***
+ * compute_batch should agree with try_compute, including the scalar tail
+ */
+TEST(exceptional_server_tests, compute_batch)
+{
+    const long long alloc_limit = 1LL << 40;
+    std::vector<long long> A = { 25581, -9252, 6003, 3850, 51975592548100, 10, 0, 1,
+            std::numeric_limits<long long>::max(), 3, 10, 2156, 99999 };
+    std::vector<long long> B = { 3661, 888, 0, 921492, 2718, -1, 0, 0,
+            7, 1, 10, 0, 98765 };
+
+    auto requests = load_requests();
+    ASSERT_FALSE(requests.empty());
+    for(const auto& [a, b] : requests)
+    {
+        A.push_back(a);
+        B.push_back(b);
+    }
+
+    std::vector<int> value(A.size());
+    std::vector<compute_error> error(A.size());
+    Server::compute_batch(A.data(), B.data(), value.data(), error.data(), A.size(), alloc_limit);
+    for(size_t i = 0; i < A.size(); ++i)
+    {
+        compute_result res = Server::try_compute(A[i], B[i]);
+        if (A[i] > alloc_limit && res.error == compute_error::none)
+            res.error = compute_error::bad_alloc;
+        EXPECT_EQ(error[i], res.error) << "A=" << A[i] << " B=" << B[i];
+        EXPECT_EQ(value[i], res.value) << "A=" << A[i] << " B=" << B[i];
+    }
+
+    // results past the range of an int wrap the same way, without the allocation
+    A = { 6000000000, 3000000000, 4503599627370495, 2147483648, 9999999999 };
+    B = { 7, 1, 3, 2147483647, 9999999998 };
+    Server::compute_batch(A.data(), B.data(), value.data(), error.data(), A.size(), 1LL << 60);
+    for(size_t i = 0; i < A.size(); ++i)
+    {
+        EXPECT_EQ(error[i], compute_error::none);
+        EXPECT_EQ(value[i], (int)(A[i] - A[i] / B[i])) << "A=" << A[i] << " B=" << B[i];
+    }
+}
+
+/***
+ * parse_batch should read the same numbers istream >> does
+ */
+TEST(exceptional_server_tests, parse_batch)
+{
+    std::vector<long long> A, B;
+    parse_batch("1\n+5 2\n", A, B);
+    ASSERT_EQ(A.size(), 1);
+    EXPECT_EQ(A[0], 5);
+    EXPECT_EQ(B[0], 2);
+
+    std::string in = "  4\n-3 +7\n\t12 0\n9223372036854775807 -1\n+-1 2\n";
+    parse_batch(in, A, B);
+    std::istringstream stream(in);
+    int T;
+    stream >> T;
+    for(size_t i = 0; i < A.size(); ++i)
+    {
+        long long a, b;
+        ASSERT_TRUE(stream >> a >> b);
+        EXPECT_EQ(A[i], a);
+        EXPECT_EQ(B[i], b);
+    }
+    // both stop at +-1
+    EXPECT_EQ(A.size(), 3);
+    long long a;
+    EXPECT_FALSE(stream >> a);
+
+    // a count bigger than the input can hold is capped by what is there
+    parse_batch("99999999999999999\n1 2\n5 1\n", A, B);
+    EXPECT_EQ(A.size(), 2);
+    parse_batch("-1\n1 2\n", A, B);
+    EXPECT_EQ(A.size(), 0);
+}
+
+TEST(exceptional_server_tests, stats)
+{
+    server_stats stats;
+    for(int i = 0; i < 98; ++i)
+        stats.record(compute_error::none, 100);
+    stats.record(compute_error::none, 5000);
+    stats.record(compute_error::none, 5000);
+    stats.record(compute_error::out_of_range);
+
+    server_stats_snapshot snapshot;
+    snapshot.add(stats);
+    snapshot.add(stats);
+    EXPECT_EQ(snapshot.total(), 202);
+    EXPECT_EQ(snapshot.count[(int)compute_error::none], 200);
+    EXPECT_EQ(snapshot.count[(int)compute_error::out_of_range], 2);
+    EXPECT_EQ(snapshot.percentile_ns(compute_error::none, 0.5), 128);
+    EXPECT_EQ(snapshot.percentile_ns(compute_error::none, 0.99), 8192);
+    EXPECT_EQ(snapshot.percentile_ns(compute_error::out_of_range, 0.99), 0);
+}
+
+/***
+ * The worker pool should print the same thing in the same order as one thread,
+ * and every call should reach the load once the workers exit
+ */
+TEST(exceptional_server_tests, run_pool)
+{
+    auto requests = load_requests();
+    ASSERT_FALSE(requests.empty());
+    std::ostringstream sequential;
+    for(const auto& [A, B] : requests)
+        handle(sequential, A, B, nullptr);
+
+    for(unsigned num_threads : { 2, 4, 8 })
+    {
+        int before = Server::getLoad();
+        std::ostringstream pooled;
+        run_pool(pooled, requests, num_threads, nullptr);
+        EXPECT_EQ(pooled.str(), sequential.str()) << num_threads << " threads";
+        EXPECT_EQ(Server::getLoad() - before, (int)requests.size()) << num_threads << " threads";
+    }
+}